@@ -1,25 +1,252 @@
-#define DEBUG_TYPE "ApproxCheck"
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "ApproxKernels.h"
+#include "ApproxTrace.h"
 #include <vector>
+#include <algorithm>
 #include <map>
+#include <set>
+#include <tuple>
+#include <functional>
+#include <memory>
 #include <utility>
 #include <string>
+#include <cstring>
+#define DEBUG_TYPE "ApproxCheck"
 using namespace llvm;
 
+static cl::opt<bool> SharedWalk("approx-shared-walk",
+	cl::desc("Propagate all address roots through the def-use graph in a single shared walk"),
+	cl::init(false));
+
+static cl::opt<bool> UseSummaries("approx-summaries",
+	cl::desc("Attach per-function argument approximability summaries and use them at call sites"),
+	cl::init(false));
+
+static cl::opt<bool> Payoff("approx-payoff",
+	cl::desc("Rank functions and loops by estimated cycles saved if their approximable instructions were approximated"),
+	cl::init(false));
+
+static cl::opt<bool> HotOnly("approx-hot-only",
+	cl::desc("Only analyse functions the profile marks as hot; cold functions get a conservative summary"),
+	cl::init(false));
+
+static cl::opt<int> HotPercentile("approx-hot-percentile",
+	cl::desc("Profile summary percentile (out of 1000000) a function must reach to count as hot"),
+	cl::init(990000));
+
+enum ExtensionPoint { EP_None, EP_PipelineStart, EP_EarlySimplification, EP_OptimizerLast };
+
+static cl::opt<ExtensionPoint> PipelinePosition("approx-check-ep",
+	cl::desc("Where the plugin inserts ApproxCheck into the default new pass manager pipeline"),
+	cl::values(
+		clEnumValN(EP_None, "none", "Only run when named in -passes=approx-check"),
+		clEnumValN(EP_PipelineStart, "start", "Before any optimization (the IR the pass was written for)"),
+		clEnumValN(EP_EarlySimplification, "early-simplification", "After early module simplification"),
+		clEnumValN(EP_OptimizerLast, "optimizer-last", "At the end of the optimization pipeline")),
+	cl::init(EP_PipelineStart));
+
+static cl::opt<bool> PrintResults("approx-check-print",
+	cl::desc("Print per-function results when run through the new pass manager"),
+	cl::init(false));
+
+static cl::opt<std::string> TraceFile("approx-trace",
+	cl::desc("Write a binary trace of analysis decisions to this file (read it with approx-trace-decode)"),
+	cl::value_desc("filename"), cl::init(""));
+
+enum LibmMode { LM_Off, LM_Accurate, LM_Fast };
+
+static cl::opt<LibmMode> Libm("approx-libm",
+	cl::desc("Replace exp, log, sin, cos and sqrt calls whose results can be approximated"),
+	cl::values(
+		clEnumValN(LM_Off, "off", "Keep all libm calls"),
+		clEnumValN(LM_Accurate, "accurate", "Inline the _accurate kernels (close to libm precision)"),
+		clEnumValN(LM_Fast, "fast", "Inline the _fast kernels (lower degree polynomials)")),
+	cl::init(LM_Off));
+
 namespace {
-	struct ApproxCheck : public FunctionPass {
-		static char ID;
-		ApproxCheck() : FunctionPass(ID) {}
+	/*
+	* Collects trace records in a preallocated ring and writes it out in one batch
+	* each time it fills up (and at the end of the module), so an event costs a
+	* 24 byte store instead of I/O. Values are recorded by address and only
+	* numbered by the decoder. The file is opened by the first traced function.
+	*/
+	class TraceWriter {
+	public:
+		TraceWriter() : ring(16384), head(0), failed(false) {}
+		~TraceWriter() { flush(); }
+
+		bool enabled() const { return out != nullptr; }
+
+		/*
+		* Starts the records of a new function: a FunctionBegin record followed by
+		* the name and the addresses of its instructions. Does nothing if tracing
+		* is off.
+		*/
+		void beginFunction(StringRef name, const std::vector<Instruction*> &instructions) {
+			if (!out && !open()) {
+				return;
+			}
+			record(approxtrace::FunctionBegin, 0, 0, name.size(), instructions.size());
+			appendPadded(name.data(), name.size());
+			std::vector<uint64_t> addresses(instructions.size());
+			for (size_t i = 0; i < instructions.size(); i++) {
+				addresses[i] = (uintptr_t)instructions[i];
+			}
+			appendPadded((const char*)addresses.data(), addresses.size() * sizeof(uint64_t));
+		}
+
+		/*
+		* level is clamped to the int16_t range of the record.
+		*/
+		void record(approxtrace::EventKind kind, uint8_t opcode, int level, uint64_t from, uint64_t to) {
+			approxtrace::Record &r = ring[head];
+			r.kind = kind;
+			r.opcode = opcode;
+			r.level = std::max(-32768, std::min(32767, level));
+			r.padding = 0;
+			r.from = from;
+			r.to = to;
+			advance();
+		}
+
+		void flush() {
+			if (out && head) {
+				out->write((const char*)ring.data(), head * sizeof(approxtrace::Record));
+				out->flush();
+			}
+			head = 0;
+		}
+
+	private:
+		void advance() {
+			if (++head == ring.size()) {
+				flush();
+			}
+		}
+
+		/*
+		* Copies size bytes into the ring, zero padded to whole records.
+		*/
+		void appendPadded(const char* data, size_t size) {
+			for (size_t i = 0; i < size; i += sizeof(approxtrace::Record)) {
+				approxtrace::Record &r = ring[head];
+				memset(&r, 0, sizeof(r));
+				memcpy(&r, data + i, std::min(sizeof(r), size - i));
+				advance();
+			}
+		}
+
+		bool open() {
+			if (TraceFile.empty() || failed) {
+				return false;
+			}
+			std::error_code EC;
+			out.reset(new raw_fd_ostream(TraceFile, EC, sys::fs::OF_None));
+			if (EC) {
+				errs() << "ApproxCheck: cannot open trace file " << TraceFile << ": " << EC.message() << "\n";
+				out.reset();
+				failed = true;
+				return false;
+			}
+			out->write(approxtrace::TraceMagic, sizeof(approxtrace::TraceMagic));
+			return true;
+		}
+
+		std::vector<approxtrace::Record> ring;
+		size_t head;
+		bool failed;
+		std::unique_ptr<raw_fd_ostream> out;
+	};
+
+	static TraceWriter Trace;
+
+	/*
+	* Canonical form of an address: a base object, a constant byte offset and a
+	* sorted list of <index value number, byte scale> terms. Two addresses with
+	* equal keys compute the same location with the same pointer type.
+	*/
+	struct AddrKey {
+		unsigned base;
+		int64_t offset;
+		Type* type;
+		std::vector<std::pair<unsigned, int64_t>> terms;
+
+		bool operator<(const AddrKey& o) const {
+			return std::tie(base, offset, type, terms) < std::tie(o.base, o.offset, o.type, o.terms);
+		}
+		bool operator==(const AddrKey& o) const {
+			return base == o.base && offset == o.offset && type == o.type && terms == o.terms;
+		}
+	};
+
+	/*
+	* The analysis itself, shared by the legacy and the new pass manager passes.
+	* The passes only fetch the analyses it needs and hand it one function at a
+	* time.
+	*/
+	struct ApproxChecker {
+		ApproxChecker(bool verbose) : verbose(verbose) {}
+		bool verbose; // print per-function results to errs()
 		std::vector<Instruction*> worklist;
 		std::vector<Value*> addrList;
 		std::map<std::string, std::pair<int, int>> opCounter; // <Opcode <total count, allow approx count>>
+		std::set<AddrKey> addrKeySet; // canonical forms of everything in addrList
+		std::map<Value*, AddrKey> addrKeys; // address -> canonical form, computed once
+		DenseMap<Value*, unsigned> valueNumbers;
+		unsigned numberCount;
+		std::map<std::vector<uintptr_t>, unsigned> exprNumbers; // <opcode, type, operand numbers> -> number
+		const DataLayout* DL;
+		std::vector<Value*> propagateList; // values the addrList roots start from, in seeding order
+		DenseSet<Value*> propagateSeen; // everything already reached by the shared walk
+		DenseSet<Instruction*> visitedStores;
+		DenseSet<Instruction*> walkedChains; // instructions checkUseChain has followed
+		DenseSet<Instruction*> walkedStoreChains; // instructions storeUseDefChain has followed
+		DenseMap<Value*, unsigned> reachedBy; // value -> last useAsData walk that reached it
+		unsigned walkNumber;
+		std::vector<std::pair<double, std::string>> payoffs; // <estimated cycles saved, function or loop>
+		TargetLibraryInfo* TLI; // only with -approx-libm or -approx-payoff
+		DenseSet<Function*> currentSCC; // functions analysed together, their summaries are not final yet
+
+		/*
+		* Records one analysis decision if -approx-trace is on.
+		*/
+		void trace(approxtrace::EventKind kind, Value* from, Value* to, int level) {
+			if (!Trace.enabled()) {
+				return;
+			}
+			Instruction* I = dyn_cast_or_null<Instruction>(to);
+			Trace.record(kind, I ? I->getOpcode() : 0, level, (uintptr_t)from, (uintptr_t)to);
+		}
 
 		/*
 		* mark this instruction is non-approximate-able
@@ -30,19 +257,6 @@ namespace {
 			vi->setMetadata("approx", N);
 		};
 
-		/*
-		* Checks whether the instruction vector contains the same instruction as the
-		* parameter passed. This is used to check if the use-def chain loops forever.
-		*/
-		bool vectorContains(std::vector<Instruction*> v, Instruction* instr) {
-			for (std::vector<Instruction*>::iterator it = v.begin(); it < v.end(); it++) {
-				if ((*it)->isIdenticalTo(instr)) {
-					return true;
-				}
-			}
-			return false;
-		};
-
 		/*
 		* find and returns the instruction in the use-def chain that corresponds to the
 		* address of a load or store instruction.
@@ -63,27 +277,32 @@ namespace {
 
 		/*
 		* A recursive function that looks for use-chains recursively.
-		* vector history is used for checking if the use-def chain loops forever.
+		* Each instruction's operands are only followed once per function, which
+		* also stops the walk on phi cycles. A summarised call may skip more
+		* operands as a root than inside a chain, so only the latter counts.
 		*/
-		void checkUseChain(Instruction* instr, int level, std::vector<Instruction*> history) {
+		void checkUseChain(Instruction* instr, int level) {
 			std::string opcode = instr->getOpcodeName();
 			bool skipFirst = (opcode == "store");
+			MDNode* summary = calleeSummary(instr);
+			if ((!summary || level > 1) && !walkedChains.insert(instr).second) {
+				return;
+			}
 
 			for (User::op_iterator i = instr->op_begin(); i != instr->op_end(); i++) {
 				if (skipFirst) {
 					skipFirst = false;
+				} else if (summary && i->getOperandNo() < summary->getNumOperands() && !summaryIsExact(summary, i->getOperandNo(), level > 1)) {
+					// The callee never uses this argument as an address or branch condition.
+					continue;
 				} else if (isa<Instruction>(*i)) {
 					Instruction *vi = dyn_cast<Instruction>(*i);
 					markInstruction(vi);
-
-					// Print
-					// for (int j = 0; j < level; j++) { errs() << "\t"; }
-					// errs() << "(" << level << ")" << *vi << "\n";
+					trace(approxtrace::MarkApplied, instr, vi, level);
 
 					std::string newopcode = vi->getOpcodeName();
-					if (newopcode != "load" && !vectorContains(history, vi)) {
-						history.push_back(vi);
-						ApproxCheck::checkUseChain(vi, level + 1, history);
+					if (newopcode != "load") {
+						checkUseChain(vi, level + 1);
 					}
 
 					if (newopcode == "load") {
@@ -91,6 +310,8 @@ namespace {
 						Value* evalAddrInst = findAddressDependency(vi);
 						if(!isInAddrList(evalAddrInst)) {
 							addrList.push_back(evalAddrInst);
+							addrKeySet.insert(canonicalAddress(evalAddrInst));
+							trace(approxtrace::RootDiscovered, vi, evalAddrInst, level);
 						}
 					}
 				}
@@ -98,66 +319,256 @@ namespace {
 		};
 
 		/*
-		* check if the two instructions have the exact same operands
+		* Returns the approximability summary of the function called by instr, or
+		* null if instr is not a direct call or the callee has no summary. Only a
+		* callee whose definition is the one that runs can be trusted, and not one
+		* of the same SCC, whose summary may still change. An available_externally
+		* copy (what ThinLTO imports) is equivalent to the real definition and
+		* keeps the summary written when the module defining it was compiled.
+		* A summary whose length no longer matches the arguments is stale.
 		*/
-		bool hasSameOperands(Value* a, Value* b, bool deep) {
-			if(a == b) {
-				return true;
+		MDNode* calleeSummary(Instruction* instr) {
+			if (!UseSummaries || !isa<CallBase>(instr)) {
+				return nullptr;
 			}
-
-			if (!isa<Instruction>(a) || !isa<Instruction>(b)) {
-				return false;
+			Function* callee = cast<CallBase>(instr)->getCalledFunction();
+			if (!callee || callee->isInterposable() || currentSCC.count(callee) ||
+					!(callee->hasExactDefinition() || callee->hasAvailableExternallyLinkage())) {
+				return nullptr;
 			}
-
-			Instruction *exactPt = dyn_cast<Instruction>(a);
-			Instruction *I = dyn_cast<Instruction>(b);
-			if (exactPt->getOpcode() != I->getOpcode() || exactPt->getNumOperands() != I->getNumOperands() || exactPt->getType() != I->getType()) {
-				return false;
+			MDNode* summary = callee->getMetadata("approx.summary");
+			if (!summary || summary->getNumOperands() != callee->arg_size()) {
+				return nullptr;
 			}
-			// If both instructions have no operands, they are identical.
-			if (exactPt->getNumOperands() == 0 && I->getNumOperands() == 0) {
-				return true;
+			return summary;
+		}
+
+		/*
+		* true if F is an imported copy whose summary came with it, which is kept
+		* rather than recomputed from the copy.
+		*/
+		bool hasImportedSummary(Function &F) {
+			return F.hasAvailableExternallyLinkage() && F.getMetadata("approx.summary");
+		}
+
+		/*
+		* true if argument number arg is marked as non-approximate-able in summary.
+		* An argument that reaches the returned value is exact when the call result
+		* is part of the chain (level > 1), not when the call itself is the root.
+		*/
+		bool summaryIsExact(MDNode* summary, unsigned arg, bool resultUsed) {
+			StringRef s = cast<MDString>(summary->getOperand(arg))->getString();
+			return s.equals("no") || (resultUsed && s.equals("ret"));
+		}
+
+		/*
+		* Records for every argument of F whether it reaches an address or a branch
+		* ("no"), only reaches the returned value ("ret") or is only used as data
+		* ("yes").
+		*/
+		void writeSummary(Function &F) {
+			LLVMContext& C = F.getContext();
+			std::vector<Metadata*> args;
+			for (Function::arg_iterator a = F.arg_begin(); a != F.arg_end(); a++) {
+				args.push_back(MDString::get(C, argumentSummary(&*a)));
 			}
+			F.setMetadata("approx.summary", MDNode::get(C, args));
+		}
 
-			// We have two instructions of identical opcode and #operands.  Check to see
-			// if all operands are the same.
-			if (!std::equal(exactPt->op_begin(), exactPt->op_end(), I->op_begin())) {
-				if (!deep) {
-					return false;
+		/*
+		* Follows the value of a through arithmetic, through the local variables it
+		* is stored to and reloaded from (the spills of -O0) and through calls whose
+		* summary says it only reaches their result. a is exact if any of these
+		* values is stored anywhere else, passed to a call that is not summarised,
+		* or used by any other instruction that touches memory or control flow.
+		* Values that are returned are left to the caller, which knows whether it
+		* uses the result as an address.
+		*/
+		const char* argumentSummary(Argument* a) {
+			std::vector<Value*> stack(1, a);
+			DenseSet<Value*> seen;
+			seen.insert(a);
+			bool returned = false;
+			while (!stack.empty()) {
+				Value* v = stack.back();
+				stack.pop_back();
+				for (Value::use_iterator u = v->use_begin(); u != v->use_end(); u++) {
+					Instruction* vi = dyn_cast<Instruction>(u->getUser());
+					if (!vi) {
+						return "no";
+					}
+					if (isa<ReturnInst>(vi)) {
+						returned = true;
+					} else if (StoreInst* store = dyn_cast<StoreInst>(vi)) {
+						AllocaInst* slot = dyn_cast<AllocaInst>(store->getPointerOperand());
+						if (store->getValueOperand() != v || !slot || !isLocalSlot(slot)) {
+							return "no";
+						}
+						for (Value::user_iterator s = slot->user_begin(); s != slot->user_end(); s++) {
+							if (isa<LoadInst>(*s) && seen.insert(*s).second) {
+								stack.push_back(*s);
+							}
+						}
+					} else if (isa<CallBase>(vi)) {
+						MDNode* summary = calleeSummary(vi);
+						if (!summary || u->getOperandNo() >= summary->getNumOperands()) {
+							return "no";
+						}
+						StringRef arg = cast<MDString>(summary->getOperand(u->getOperandNo()))->getString();
+						if (arg.equals("no")) {
+							return "no";
+						}
+						if (arg.equals("ret") && seen.insert(vi).second) {
+							stack.push_back(vi);
+						}
+					} else if (vi->isTerminator() || vi->mayReadOrWriteMemory()) {
+						return "no";
+					} else if (seen.insert(vi).second) {
+						stack.push_back(vi);
+					}
 				}
+			}
+			return returned ? "ret" : "yes";
+		}
 
-				for (User::op_iterator i = exactPt->op_begin(), j = I->op_begin(); i != exactPt->op_end() && j != I->op_end(); i++, j++) {
-					if(!hasSameOperands(*i, *j, true)) {
+		/*
+		* true if the alloca is only ever loaded from and stored to, so the values
+		* stored in it can only come back out through its loads.
+		*/
+		bool isLocalSlot(AllocaInst* slot) {
+			for (Value::user_iterator useI = slot->user_begin(); useI != slot->user_end(); useI++) {
+				if (StoreInst* store = dyn_cast<StoreInst>(*useI)) {
+					if (store->getValueOperand() == slot) {
 						return false;
 					}
+				} else if (!isa<LoadInst>(*useI) && !isLifetimeMarker(*useI)) {
+					return false;
 				}
-				return true;
 			}
 			return true;
 		}
 
 		/*
-		* compares the instruction to the list. If the instruction has all the same
-		* operands as any of the addrList elements' operands, then return true.
+		* true for llvm.lifetime.start/end, or a cast only they use (what clang
+		* emits for local variables with optimization on).
 		*/
-		bool isInAddrList(Value* I) {
-			for (std::vector<Value*>::iterator it = addrList.begin(); it < addrList.end(); it++) {
-				Value* exactPt = *it;
-				if (hasSameOperands(exactPt, I, true)) {
-					return true;
+		bool isLifetimeMarker(User* u) {
+			if (IntrinsicInst* II = dyn_cast<IntrinsicInst>(u)) {
+				return II->isLifetimeStartOrEnd();
+			}
+			if (!isa<BitCastInst>(u)) {
+				return false;
+			}
+			for (Value::user_iterator useI = u->user_begin(); useI != u->user_end(); useI++) {
+				IntrinsicInst* II = dyn_cast<IntrinsicInst>(*useI);
+				if (!II || !II->isLifetimeStartOrEnd()) {
+					return false;
 				}
 			}
-			return false;
+			return true;
+		}
+
+		/*
+		* Gives v a number such that two values computing the same expression from
+		* the same operands get the same number. Loads are numbered by their address
+		* like any other expression. Allocas, phis and instructions with side effects
+		* are only equal to themselves.
+		*/
+		unsigned valueNumber(Value* v) {
+			DenseMap<Value*, unsigned>::iterator found = valueNumbers.find(v);
+			if (found != valueNumbers.end()) {
+				return found->second;
+			}
+
+			unsigned number;
+			Instruction* I = dyn_cast<Instruction>(v);
+			if (!I || isa<AllocaInst>(I) || isa<PHINode>(I) || (I->mayReadOrWriteMemory() && !isa<LoadInst>(I))) {
+				number = numberCount++;
+			} else {
+				std::vector<uintptr_t> expr;
+				expr.push_back(I->getOpcode());
+				expr.push_back((uintptr_t)I->getType());
+				if (CmpInst* C = dyn_cast<CmpInst>(I)) {
+					expr.push_back(C->getPredicate());
+				}
+				if (GetElementPtrInst* G = dyn_cast<GetElementPtrInst>(I)) {
+					expr.push_back((uintptr_t)G->getSourceElementType());
+				}
+				for (User::op_iterator i = I->op_begin(); i != I->op_end(); i++) {
+					expr.push_back(valueNumber(*i));
+				}
+				std::map<std::vector<uintptr_t>, unsigned>::iterator e = exprNumbers.find(expr);
+				if (e != exprNumbers.end()) {
+					number = e->second;
+				} else {
+					number = numberCount++;
+					exprNumbers[expr] = number;
+				}
+			}
+			valueNumbers[v] = number;
+			return number;
+		}
+
+		/*
+		* Computes (once per address) the canonical <base, byte offset, index terms>
+		* form of a pointer by folding GEP chains and pointer casts. Struct fields
+		* become part of the constant offset, so neighbouring fields stay distinct.
+		*/
+		const AddrKey& canonicalAddress(Value* v) {
+			std::map<Value*, AddrKey>::iterator found = addrKeys.find(v);
+			if (found != addrKeys.end()) {
+				return found->second;
+			}
+
+			AddrKey key;
+			if (GEPOperator* gep = dyn_cast<GEPOperator>(v)) {
+				key = canonicalAddress(gep->getPointerOperand());
+				for (gep_type_iterator t = gep_type_begin(gep), e = gep_type_end(gep); t != e; ++t) {
+					Value* idx = t.getOperand();
+					ConstantInt* c = dyn_cast<ConstantInt>(idx);
+					if (StructType* st = t.getStructTypeOrNull()) {
+						key.offset += DL->getStructLayout(st)->getElementOffset(c->getZExtValue());
+						continue;
+					}
+					int64_t size = DL->getTypeAllocSize(t.getIndexedType()).getFixedSize();
+					if (c) {
+						key.offset += c->getSExtValue() * size;
+					} else {
+						key.terms.push_back(std::make_pair(valueNumber(idx), size));
+					}
+				}
+				std::sort(key.terms.begin(), key.terms.end());
+			} else if (isa<BitCastOperator>(v) || isa<AddrSpaceCastOperator>(v)) {
+				key = canonicalAddress(cast<Operator>(v)->getOperand(0));
+			} else {
+				key.base = valueNumber(v);
+				key.offset = 0;
+			}
+			key.type = v->getType();
+			return addrKeys[v] = key;
+		}
+
+		/*
+		* compares the address to the list. If it has the same canonical form as any
+		* of the addrList elements, then return true.
+		*/
+		bool isInAddrList(Value* I) {
+			return addrKeySet.count(canonicalAddress(I)) != 0;
 		};
 
+		/*
+		* Marks everything the value stored by instr is computed from, up to the
+		* loads. Each instruction is only followed once per function.
+		*/
 		void storeUseDefChain(Instruction* instr, int level) {
-			// for (int j = 0; j < level; j++) { errs() << "\t"; }
-			// errs() << "(" << level << ")" << *instr << "\n";
-
+			if (!walkedStoreChains.insert(instr).second) {
+				return;
+			}
 			for (User::op_iterator i = instr->op_begin(); i != instr->op_end(); i++) {
 				if (isa<Instruction>(*i)) {
 					Instruction *vi = dyn_cast<Instruction>(*i);
 					markInstruction(vi);
+					trace(approxtrace::MarkApplied, instr, vi, level);
 
 					std::string opcode = vi->getOpcodeName();
 					if (opcode != "load") {
@@ -169,26 +580,63 @@ namespace {
 
 		/*
 		* Returns true if the the use of that instruction is used as data of
-		* a store instruction.
+		* a store instruction. Each walk (one per root) reaches a value only
+		* once, so shared operands and phi cycles are not walked again.
 		*/
 		void useAsData(Value* instr, int level) {
 			for (Value::user_iterator useI = instr->user_begin(); useI != instr->user_end(); useI++) {
-				Instruction *vi = dyn_cast<Instruction>(*useI);
+				trace(approxtrace::EdgeFollowed, instr, *useI, level);
 
-				// for (int j = 0; j < level; j++) { errs() << "\t"; }
-				// errs() << "(" << level << ")" << *vi << "\n";
-
-				std::string opcode = vi->getOpcodeName();
-				if (opcode == "store") {
-					Value* addressVi = findAddressDependency(vi);
+				if (StoreInst* store = dyn_cast<StoreInst>(*useI)) {
+					Value* addressVi = findAddressDependency(store);
 					// if this addressVi is in the addrList, then we're using
 					// pointer as data. Therefore everything here should not
-					// be approximated.
-					if (isInAddrList(addressVi)) {
-						storeUseDefChain(vi, level + 1);
+					// be approximated. The answer is the same for every root.
+					if (visitedStores.insert(store).second && isInAddrList(addressVi)) {
+						trace(approxtrace::StoreMatched, instr, store, level);
+						storeUseDefChain(store, level + 1);
 					}
 				} else {
-					useAsData(*useI, level + 1);
+					unsigned &reached = reachedBy[*useI];
+					if (reached != walkNumber) {
+						reached = walkNumber;
+						useAsData(*useI, level + 1);
+					}
+				}
+			}
+		}
+
+		/*
+		* Adds v to the starting points of the shared walk, once.
+		*/
+		void seedRoot(Value* v) {
+			if (propagateSeen.insert(v).second) {
+				propagateList.push_back(v);
+			}
+		}
+
+		/*
+		* Shared-walk version of useAsData. Whether a store is matched only depends
+		* on its address, not on which root reached it, so all roots are followed
+		* through the def-use graph together and every value and store is visited
+		* once. Unlike useAsData this is linear in the number of edges and also
+		* terminates on def-use cycles through phis.
+		*/
+		void useAsDataShared() {
+			std::vector<Value*> stack(propagateList.rbegin(), propagateList.rend());
+			while (!stack.empty()) {
+				Value* v = stack.back();
+				stack.pop_back();
+				for (Value::user_iterator useI = v->user_begin(); useI != v->user_end(); useI++) {
+					if (StoreInst* store = dyn_cast<StoreInst>(*useI)) {
+						if (visitedStores.insert(store).second && isInAddrList(findAddressDependency(store))) {
+							trace(approxtrace::StoreMatched, v, store, 0);
+							storeUseDefChain(store, 1);
+						}
+					} else if (propagateSeen.insert(*useI).second) {
+						trace(approxtrace::EdgeFollowed, v, *useI, 0);
+						stack.push_back(*useI);
+					}
 				}
 			}
 		}
@@ -222,73 +670,512 @@ namespace {
 		}
 
 		/*
-		* The actual function pass being run. It calls the functions above.
+		* Only arithmetic and the libm calls -approx-libm can replace are counted
+		* towards the payoff. Memory operations, control flow and pointer casts are
+		* never replaced by an approximate version.
+		*/
+		bool isApproxCandidate(Instruction* I) {
+			if (isa<BinaryOperator>(I) || isa<UnaryOperator>(I) || findLibmKernel(I)) {
+				return true;
+			}
+			return isa<CastInst>(I) && !I->getType()->isPointerTy() && !I->getOperand(0)->getType()->isPointerTy();
+		}
+
+		/*
+		* Estimates the cycles that would be saved in F and in each of its loops if
+		* every approximable instruction were approximated. Each instruction is
+		* weighted by its TargetTransformInfo latency and by how often its block runs
+		* relative to the function entry. With a profile the estimate is scaled by
+		* the function entry count, otherwise it is per call.
+		*/
+		void estimatePayoff(Function &F, TargetTransformInfo &TTI, BlockFrequencyInfo &BFI, LoopInfo &LI) {
+			double entryFreq = BFI.getEntryFreq();
+			double calls = 1;
+			Optional<Function::ProfileCount> count = F.getEntryCount();
+			if (count.hasValue()) {
+				calls = count->getCount();
+			}
+
+			double total = 0;
+			std::map<Loop*, double> loopTotals;
+			for (Function::iterator bb = F.begin(), e = F.end(); bb != e; ++bb) {
+				double weight = calls * BFI.getBlockFreq(&*bb).getFrequency() / entryFreq;
+				double cycles = 0;
+				for (BasicBlock::iterator i = bb->begin(), e = bb->end(); i != e; ++i) {
+					if (i->getMetadata("approx") || !isApproxCandidate(&*i)) {
+						continue;
+					}
+					InstructionCost cost = TTI.getInstructionCost(&*i, TargetTransformInfo::TCK_Latency);
+					if (cost.isValid()) {
+						cycles += *cost.getValue();
+					}
+				}
+				total += cycles * weight;
+				for (Loop* L = LI.getLoopFor(&*bb); L; L = L->getParentLoop()) {
+					loopTotals[L] += cycles * weight;
+				}
+			}
+
+			payoffs.push_back(std::make_pair(total, "function " + F.getName().str()));
+			for (std::map<Loop*, double>::iterator l = loopTotals.begin(); l != loopTotals.end(); l++) {
+				std::string name;
+				raw_string_ostream OS(name);
+				OS << "loop " << F.getName() << ":";
+				l->first->getHeader()->printAsOperand(OS, false);
+				OS << " (depth " << l->first->getLoopDepth() << ")";
+				payoffs.push_back(std::make_pair(l->second, OS.str()));
+			}
+		}
+
+		/*
+		* Prints the payoff ranking collected over the whole module, largest first.
+		*/
+		void printPayoff() {
+			if (Payoff) {
+				std::stable_sort(payoffs.begin(), payoffs.end(), std::greater<std::pair<double, std::string>>());
+				errs() << "\n===================" << "Approximation payoff" << "===================\n\n";
+				for (std::vector<std::pair<double, std::string>>::iterator i = payoffs.begin(); i != payoffs.end(); i++) {
+					errs() << (i - payoffs.begin() + 1) << ". " << i->second << ": " << format("%.1f", i->first) << " cycles saved\n";
+				}
+				errs() << "\n";
+			}
+			payoffs.clear();
+		}
+
+		/*
+		* true if F should be skipped because the profile says it is cold. Without
+		* a profile summary every function is analysed.
+		*/
+		bool isColdFunction(Function &F, ProfileSummaryInfo *PSI, BlockFrequencyInfo *BFI) {
+			if (!HotOnly || !PSI->hasProfileSummary()) {
+				return false;
+			}
+			return !PSI->isFunctionHotInCallGraphNthPercentile(HotPercentile, &F, *BFI);
+		}
+
+		/*
+		* Cheap result for a skipped function: every argument is assumed to reach an
+		* address, so callers stay as conservative as without a summary.
+		*/
+		void writeConservativeSummary(Function &F) {
+			LLVMContext& C = F.getContext();
+			std::vector<Metadata*> args(F.arg_size(), MDString::get(C, "no"));
+			F.setMetadata("approx.summary", MDNode::get(C, args));
+		}
+
+		/*
+		* Returns the kernel that can replace instr if it is a scalar double or float
+		* call to one of the LibmKernels functions (or their intrinsics).
+		*/
+		const approxkernels::LibmKernel* findLibmKernel(Instruction* instr) {
+			CallInst* CI = dyn_cast<CallInst>(instr);
+			if (!CI || !CI->getCalledFunction() || !(CI->getType()->isDoubleTy() || CI->getType()->isFloatTy())) {
+				return nullptr;
+			}
+			Function* callee = CI->getCalledFunction();
+			LibFunc func;
+			bool isLibCall = !CI->isNoBuiltin() && TLI->getLibFunc(*callee, func) && TLI->has(func);
+			for (unsigned k = 0; k < approxkernels::NumLibmKernels; k++) {
+				const approxkernels::LibmKernel* kernel = &approxkernels::LibmKernels[k];
+				if (callee->getIntrinsicID() == kernel->intrinsic ||
+						(isLibCall && (func == kernel->doubleFunc || func == kernel->floatFunc))) {
+					return kernel;
+				}
+			}
+			return nullptr;
+		}
+
+		/*
+		* Replaces every unmarked libm call in F by its kernel (or sqrt by
+		* llvm.sqrt) and reports each substitution with the kernel's expected
+		* error. The kernels are built into the module and inlined right away, so
+		* the result does not depend on where the pass runs in the pipeline.
+		*/
+		bool substituteLibmCalls(Function &F, OptimizationRemarkEmitter &ORE) {
+			std::vector<CallInst*> calls;
+			for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+				// llvm.sqrt is already what sqrt calls are replaced with.
+				if (!I->getMetadata("approx") && findLibmKernel(&*I) &&
+						cast<CallInst>(&*I)->getCalledFunction()->getIntrinsicID() != Intrinsic::sqrt) {
+					calls.push_back(cast<CallInst>(&*I));
+				}
+			}
+
+			Module* M = F.getParent();
+			std::set<Function*> kernels;
+			for (std::vector<CallInst*>::iterator c = calls.begin(); c != calls.end(); c++) {
+				CallInst* CI = *c;
+				const approxkernels::LibmKernel* kernel = findLibmKernel(CI);
+				Type* T = CI->getType();
+				bool isFloat = T->isFloatTy();
+
+				Function* replacement;
+				if (kernel->intrinsic == Intrinsic::sqrt) {
+					replacement = Intrinsic::getDeclaration(M, Intrinsic::sqrt, T);
+				} else {
+					replacement = approxkernels::getKernel(*M, *kernel, T, Libm == LM_Fast);
+					kernels.insert(replacement);
+				}
+
+				CallInst* NC = CallInst::Create(replacement, CI->getArgOperand(0), "", CI);
+				NC->takeName(CI);
+				NC->setDebugLoc(CI->getDebugLoc());
+				NC->copyFastMathFlags(CI);
+				CI->replaceAllUsesWith(NC);
+
+				std::string expected = approxkernels::describeError(*kernel, isFloat, Libm == LM_Fast);
+				ORE.emit([&]() {
+					return OptimizationRemark(DEBUG_TYPE, "LibmSubstituted", NC)
+						<< "replaced " << ore::NV("Callee", CI->getCalledFunction()) << " with "
+						<< ore::NV("Kernel", replacement) << ", expected " << ore::NV("Error", expected);
+				});
+				CI->eraseFromParent();
+
+				if (replacement->getIntrinsicID() != Intrinsic::sqrt) {
+					InlineFunctionInfo IFI;
+					InlineFunction(*NC, IFI);
+				}
+			}
+
+			// Kernels only exist to be inlined.
+			for (std::set<Function*>::iterator k = kernels.begin(); k != kernels.end(); k++) {
+				if ((*k)->use_empty()) {
+					(*k)->eraseFromParent();
+				}
+			}
+			return !calls.empty();
+		}
+
+		/*
+		* Analyses one function. It calls the functions above. PSI and BFI are only
+		* needed with -approx-hot-only, TTI and LI (and BFI) only with -approx-payoff,
+		* TLI only with -approx-libm or -approx-payoff. Returns true if libm calls
+		* were replaced.
 		*/
-		virtual bool runOnFunction(Function &F) {
-			errs() << "\n===================" << "Function " << F.getName() << "===================\n\n";
+		bool run(Function &F, OptimizationRemarkEmitter &ORE, ProfileSummaryInfo *PSI, BlockFrequencyInfo *BFI,
+				TargetTransformInfo *TTI, LoopInfo *LI, TargetLibraryInfo *TLI) {
+			this->TLI = TLI;
+			if (verbose) {
+				errs() << "\n===================" << "Function " << F.getName() << "===================\n\n";
+			}
 
+			if (isColdFunction(F, PSI, BFI)) {
+				if (verbose) {
+					errs() << "skipped (cold)\n\n";
+				}
+				if (UseSummaries && !hasImportedSummary(F)) {
+					writeConservativeSummary(F);
+				}
+				ORE.emit([&]() {
+					return OptimizationRemarkAnalysis(DEBUG_TYPE, "ColdFunction", &F) << "skipped cold function";
+				});
+				return false;
+			}
+
+			DL = &F.getParent()->getDataLayout();
+			numberCount = 0;
+			walkNumber = 0;
 			for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
 				worklist.push_back(&*I);
+				// Marks from an earlier run (e.g. before ThinLTO imported the
+				// summaries of other modules) are recomputed from scratch.
+				I->setMetadata("approx", nullptr);
 			}
+			Trace.beginFunction(F.getName(), worklist);
 
 			// Step 1) Find all places where an address is being used.
 			// Step 2) If the address is stored in memory, locate the addresses that point to those memory locations.
 			for(std::vector<Instruction*>::iterator i = worklist.begin(); i != worklist.end(); i++) {
 				Instruction* instr = *i;
 				std::string opcode = instr->getOpcodeName();
-				if (instr->mayReadOrWriteMemory() || opcode == "br" || opcode == "ret") {
-					// errs() << "(0)" << *instr << "\n";
-					std::vector<Instruction*> history;
-					checkUseChain(instr, 1, history);
+				// With -approx-libm, math calls only touch errno and are not roots.
+				bool mathCall = Libm != LM_Off && findLibmKernel(instr);
+				if ((instr->mayReadOrWriteMemory() && !mathCall) || opcode == "br" || opcode == "ret") {
+					trace(approxtrace::ChainStart, nullptr, instr, 0);
+					checkUseChain(instr, 1);
 				}
 			}
 
-			for (std::vector<Value*>::iterator i = addrList.begin(); i < addrList.end(); i++) {
-				errs() << **i << "\n";
+			if (verbose) {
+				for (std::vector<Value*>::iterator i = addrList.begin(); i < addrList.end(); i++) {
+					errs() << **i << "\n";
+				}
 			}
 
 			// Step 3) Find all places where the address is being operated on.
+			std::map<AddrKey, std::vector<Instruction*>> sameAddress;
+			for(std::vector<Instruction*>::iterator i = worklist.begin(); i != worklist.end(); i++) {
+				if ((*i)->getType()->isPointerTy()) {
+					sameAddress[canonicalAddress(*i)].push_back(*i);
+				}
+			}
 			for (std::vector<Value*>::iterator i = addrList.begin(); i < addrList.end(); i++) {
 				Value* v = *i;
-				useAsData(v, 1);
-
-				// alloca is a special case. We do not want to let it check against all local variables of the same type.
-				std::string newopcode = "";
-				if (isa<Instruction>(v)) {
-					Instruction *I = dyn_cast<Instruction>(v);
-					newopcode = I->getOpcodeName();
+				if (SharedWalk) {
+					seedRoot(v);
+				} else {
+					++walkNumber;
+					useAsData(v, 1);
 				}
 
-				if (newopcode != "alloca") {
-					for(std::vector<Instruction*>::iterator i = worklist.begin(); i != worklist.end(); i++) {
-						Value* instr = *i;
-						if (hasSameOperands(v, instr, false)) {
-							// errs() << "(0)" << *instr << "\n";
+				// Other instructions computing the same canonical address. Allocas are
+				// their own base, so they only ever match themselves.
+				std::map<AddrKey, std::vector<Instruction*>>::iterator same = sameAddress.find(canonicalAddress(v));
+				if (same != sameAddress.end()) {
+					for (std::vector<Instruction*>::iterator j = same->second.begin(); j != same->second.end(); j++) {
+						Instruction* instr = *j;
+						if (instr == v) {
+							continue;
+						}
+						trace(approxtrace::SameAddress, v, instr, 0);
+						if (SharedWalk) {
+							seedRoot(instr);
+						} else {
+							++walkNumber;
 							useAsData(instr, 1);
 						}
 					}
 				}
 			}
 
+			if (SharedWalk) {
+				useAsDataShared();
+			}
+
+			if (UseSummaries && !hasImportedSummary(F)) {
+				writeSummary(F);
+			}
+
 			countOpcodes(F);
 
+			if (Payoff) {
+				estimatePayoff(F, *TTI, *BFI, *LI);
+			}
+
 			// Print approx counts
+			int total = 0, approx = 0;
 			std::map <std::string, std::pair<int, int>>::iterator i = opCounter.begin();
 			while (i != opCounter.end()) {
-				errs() << i->first << ": " << i->second.second << "/" << i->second.first << " can be approximated\n";
+				if (verbose) {
+					errs() << i->first << ": " << i->second.second << "/" << i->second.first << " can be approximated\n";
+				}
+				total += i->second.first;
+				approx += i->second.second;
 				i++;
 			}
-			errs() << "\n";
+			if (verbose) {
+				errs() << "\n";
+			}
 
+			ORE.emit([&]() {
+				return OptimizationRemarkAnalysis(DEBUG_TYPE, "Approximable", &F)
+					<< ore::NV("Approximable", approx) << "/" << ore::NV("Total", total)
+					<< " instructions can be approximated";
+			});
+
+			bool changed = false;
+			if (Libm != LM_Off) {
+				changed = substituteLibmCalls(F, ORE);
+			}
 
 			worklist.clear();
 			opCounter.clear();
 			addrList.clear();
-			return false;
+			addrKeySet.clear();
+			addrKeys.clear();
+			valueNumbers.clear();
+			exprNumbers.clear();
+			propagateList.clear();
+			propagateSeen.clear();
+			visitedStores.clear();
+			walkedChains.clear();
+			walkedStoreChains.clear();
+			reachedBy.clear();
+			return changed;
 		};
 
 	};
+
+	/*
+	* Groups the defined functions of M in the order they are analysed. With
+	* -approx-summaries the groups are the SCCs of the call graph in post-order,
+	* so callees are summarised before their callers whatever the order of the
+	* module. Otherwise every function is its own group, in module order.
+	*/
+	std::vector<std::vector<Function*>> analysisOrder(Module &M) {
+		std::vector<std::vector<Function*>> order;
+		if (!UseSummaries) {
+			for (Module::iterator f = M.begin(); f != M.end(); f++) {
+				if (!f->isDeclaration()) {
+					order.push_back(std::vector<Function*>(1, &*f));
+				}
+			}
+			return order;
+		}
+
+		CallGraph CG(M);
+		for (scc_iterator<CallGraph*> scc = scc_begin(&CG); !scc.isAtEnd(); ++scc) {
+			std::vector<Function*> group;
+			for (std::vector<CallGraphNode*>::const_iterator n = (*scc).begin(); n != (*scc).end(); n++) {
+				Function* F = (*n)->getFunction();
+				if (F && !F->isDeclaration()) {
+					group.push_back(F);
+				}
+			}
+			if (!group.empty()) {
+				order.push_back(group);
+			}
+		}
+		return order;
+	}
+
+	/*
+	* Legacy pass manager wrapper, used by opt -load ... -ApproxCheck.
+	* It is a module pass so functions can be visited in analysisOrder.
+	*/
+	struct ApproxCheck : public ModulePass {
+		static char ID;
+		ApproxChecker checker;
+		ApproxCheck() : ModulePass(ID), checker(true) {}
+
+		virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+			AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+			if (Payoff || HotOnly) {
+				AU.addRequired<BlockFrequencyInfoWrapperPass>();
+			}
+			if (Payoff) {
+				AU.addRequired<TargetTransformInfoWrapperPass>();
+				AU.addRequired<LoopInfoWrapperPass>();
+			}
+			if (HotOnly) {
+				AU.addRequired<ProfileSummaryInfoWrapperPass>();
+			}
+			if (Libm != LM_Off || Payoff) {
+				AU.addRequired<TargetLibraryInfoWrapperPass>();
+			}
+		}
+
+		virtual bool runOnModule(Module &M) {
+			std::vector<std::vector<Function*>> order = analysisOrder(M);
+			bool changed = false;
+			for (std::vector<std::vector<Function*>>::iterator group = order.begin(); group != order.end(); group++) {
+				checker.currentSCC.clear();
+				checker.currentSCC.insert(group->begin(), group->end());
+				for (std::vector<Function*>::iterator f = group->begin(); f != group->end(); f++) {
+					changed |= analyseFunction(**f);
+				}
+			}
+			checker.printPayoff();
+			Trace.flush();
+			return changed;
+		}
+
+		bool analyseFunction(Function &F) {
+			ProfileSummaryInfo *PSI = nullptr;
+			BlockFrequencyInfo *BFI = nullptr;
+			TargetTransformInfo *TTI = nullptr;
+			LoopInfo *LI = nullptr;
+			TargetLibraryInfo *TLI = nullptr;
+			if (HotOnly) {
+				PSI = &getAnalysis<ProfileSummaryInfoWrapperPass>().getPSI();
+			}
+			if (Payoff || HotOnly) {
+				BFI = &getAnalysis<BlockFrequencyInfoWrapperPass>(F).getBFI();
+			}
+			if (Payoff) {
+				TTI = &getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+				LI = &getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+			}
+			if (Libm != LM_Off || Payoff) {
+				TLI = &getAnalysis<TargetLibraryInfoWrapperPass>().getTLI(F);
+			}
+			// Last: each getAnalysis(F) reruns the function analyses, which
+			// replaces the remark emitter.
+			OptimizationRemarkEmitter &ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>(F).getORE();
+			return checker.run(F, ORE, PSI, BFI, TTI, LI, TLI);
+		}
+	};
+
+	/*
+	* New pass manager pass, used by opt -load-pass-plugin and clang -fpass-plugin.
+	* It is a module pass so the payoff ranking can be printed once at the end.
+	*/
+	struct ApproxCheckPass : public PassInfoMixin<ApproxCheckPass> {
+		PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM) {
+			ApproxChecker checker(PrintResults);
+			FunctionAnalysisManager &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+			ProfileSummaryInfo *PSI = nullptr;
+			if (HotOnly) {
+				PSI = &MAM.getResult<ProfileSummaryAnalysis>(M);
+			}
+			bool changed = false;
+
+			std::vector<std::vector<Function*>> order = analysisOrder(M);
+			for (std::vector<std::vector<Function*>>::iterator group = order.begin(); group != order.end(); group++) {
+				checker.currentSCC.clear();
+				checker.currentSCC.insert(group->begin(), group->end());
+				for (std::vector<Function*>::iterator f = group->begin(); f != group->end(); f++) {
+					Function &F = **f;
+					BlockFrequencyInfo *BFI = nullptr;
+					TargetTransformInfo *TTI = nullptr;
+					LoopInfo *LI = nullptr;
+					TargetLibraryInfo *TLI = nullptr;
+					if (Payoff || HotOnly) {
+						BFI = &FAM.getResult<BlockFrequencyAnalysis>(F);
+					}
+					if (Payoff) {
+						TTI = &FAM.getResult<TargetIRAnalysis>(F);
+						LI = &FAM.getResult<LoopAnalysis>(F);
+					}
+					if (Libm != LM_Off || Payoff) {
+						TLI = &FAM.getResult<TargetLibraryAnalysis>(F);
+					}
+					if (checker.run(F, FAM.getResult<OptimizationRemarkEmitterAnalysis>(F), PSI, BFI, TTI, LI, TLI)) {
+						FAM.invalidate(F, PreservedAnalyses::none());
+						changed = true;
+					}
+				}
+			}
+
+			checker.printPayoff();
+			Trace.flush();
+			// Apart from replaced libm calls only metadata is added, which no
+			// analysis depends on.
+			return changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+		}
+	};
+
+	/*
+	* Adds ApproxCheckPass to the default pipeline if -approx-check-ep selects the
+	* extension point the callback was registered for.
+	*/
+	void addAtExtensionPoint(ExtensionPoint EP, ModulePassManager &MPM) {
+		if (PipelinePosition == EP) {
+			MPM.addPass(ApproxCheckPass());
+		}
+	}
 }
 
 char ApproxCheck::ID = 0;
 static RegisterPass<ApproxCheck> X("ApproxCheck", "Looks for dependencies in functions");
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+	return {LLVM_PLUGIN_API_VERSION, "ApproxCheck", LLVM_VERSION_STRING, [](PassBuilder &PB) {
+		PB.registerPipelineParsingCallback([](StringRef Name, ModulePassManager &MPM, ArrayRef<PassBuilder::PipelineElement>) {
+			if (Name == "approx-check") {
+				MPM.addPass(ApproxCheckPass());
+				return true;
+			}
+			return false;
+		});
+		PB.registerPipelineStartEPCallback([](ModulePassManager &MPM, OptimizationLevel) {
+			addAtExtensionPoint(EP_PipelineStart, MPM);
+		});
+		PB.registerPipelineEarlySimplificationEPCallback([](ModulePassManager &MPM, OptimizationLevel) {
+			addAtExtensionPoint(EP_EarlySimplification, MPM);
+		});
+		PB.registerOptimizerLastEPCallback([](ModulePassManager &MPM, OptimizationLevel) {
+			addAtExtensionPoint(EP_OptimizerLast, MPM);
+		});
+	}};
+}
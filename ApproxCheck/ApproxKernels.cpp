@@ -0,0 +1,313 @@
+#include "ApproxKernels.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include <cmath>
+#include <string>
+using namespace llvm;
+
+namespace approxkernels {
+	const LibmKernel LibmKernels[] = {
+		{LibFunc_exp, LibFunc_expf, Intrinsic::exp, "exp", Relative, {0, 0},
+			{{{13, 0}, 4.0e-16}, {{8, 0}, 1.0e-7}}, {{{6, 0}, 3.3e-6}, {{4, 0}, 8.0e-4}}},
+		{LibFunc_log, LibFunc_logf, Intrinsic::log, "log", AbsoluteBelowOne, {0, 0},
+			{{{10, 0}, 1.7e-16}, {{5, 0}, 1.1e-7}}, {{{3, 0}, 1.3e-6}, {{2, 0}, 6.1e-5}}},
+		{LibFunc_sin, LibFunc_sinf, Intrinsic::sin, "sin", Absolute, {1e5, 1e4},
+			{{{8, 9}, 2.1e-16}, {{5, 6}, 8.5e-8}}, {{{4, 5}, 3.2e-7}, {{3, 4}, 3.7e-5}}},
+		{LibFunc_cos, LibFunc_cosf, Intrinsic::cos, "cos", Absolute, {1e5, 1e4},
+			{{{8, 9}, 2.1e-16}, {{5, 6}, 8.5e-8}}, {{{4, 5}, 3.2e-7}, {{3, 4}, 3.7e-5}}},
+		{LibFunc_sqrt, LibFunc_sqrtf, Intrinsic::sqrt, "sqrt", Exact, {0, 0},
+			{{{0, 0}, 0}, {{0, 0}, 0}}, {{{0, 0}, 0}, {{0, 0}, 0}}},
+	};
+	const unsigned NumLibmKernels = sizeof(LibmKernels) / sizeof(LibmKernels[0]);
+}
+
+using namespace approxkernels;
+
+namespace {
+	/* Taylor coefficients: 1/n!, 2/(2n+1), (-1)^n/(2n+1)! and (-1)^n/(2n)! */
+	const double ExpCoefficients[] = {
+		1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320,
+		1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600
+	};
+	const double LogCoefficients[] = {
+		2.0, 2.0 / 3, 2.0 / 5, 2.0 / 7, 2.0 / 9, 2.0 / 11, 2.0 / 13, 2.0 / 15, 2.0 / 17, 2.0 / 19
+	};
+	const double SinCoefficients[] = {
+		1.0, -1.0 / 6, 1.0 / 120, -1.0 / 5040, 1.0 / 362880, -1.0 / 39916800, 1.0 / 6227020800.0,
+		-1.0 / 1307674368000.0
+	};
+	const double CosCoefficients[] = {
+		1.0, -1.0 / 2, 1.0 / 24, -1.0 / 720, 1.0 / 40320, -1.0 / 3628800, 1.0 / 479001600,
+		-1.0 / 87178291200.0, 1.0 / 20922789888000.0
+	};
+
+	/*
+	* Constants of the kernels for one floating point type. ln(2) and pi/2 are
+	* split so that k * hi is exact for the reduced ranges used below.
+	*/
+	struct TypeConstants {
+		unsigned mantissaBits;
+		int64_t bias;
+		double shift; // 1.5 * 2^mantissaBits: adding it rounds to an integer in the low bits
+		// exp
+		double expClampHigh, expClampLow, expInfinityAbove, expZeroBelow, invLn2, ln2Hi, ln2Lo;
+		// log
+		double minNormal, subnormalScale, subnormalExponent;
+		uint64_t exponentMask, mantissaMask, one;
+		// sin and cos
+		double invPio2, pio2[3];
+	};
+
+	const TypeConstants Constants[2] = {
+		{52, 1023, 0x1.8p52,
+			709.79, -745.14, 709.782712893384, -745.13321910194122, 1.44269504088896338700,
+			6.93147180369123816490e-01, 1.90821492927058770002e-10,
+			2.2250738585072014e-308, 0x1p54, 54, 0x7ff, 0x000fffffffffffffULL, 0x3ff0000000000000ULL,
+			6.36619772367581382433e-01, {1.57079632673412561417e+00, 6.07710050630396597660e-11, 2.02226624871116645580e-21}},
+		{23, 127, 0x1.8p23,
+			88.72, -103.98, 88.7228391, -103.972077, 1.44269504,
+			6.9314575195e-01, 1.4286067653e-06,
+			1.17549435e-38, 0x1p25, 25, 0xff, 0x007fffff, 0x3f800000,
+			6.36619772e-01, {1.5703125, 4.8375129699707031e-04, 7.5497899548918821e-08}},
+	};
+
+	/*
+	* IRBuilder with the helpers the kernels share. Every value has the kernel's
+	* floating point type T or the integer type of the same width.
+	*/
+	struct KernelBuilder {
+		IRBuilder<> &B;
+		Type* T;
+		IntegerType* I;
+		const TypeConstants &K;
+
+		KernelBuilder(IRBuilder<> &B, Type* T) : B(B), T(T),
+			I(IntegerType::get(T->getContext(), T->getPrimitiveSizeInBits())), K(Constants[T->isFloatTy()]) {}
+
+		Value* fp(double v) { return ConstantFP::get(T, v); }
+		Value* integer(uint64_t v) { return ConstantInt::get(I, v); }
+		Value* bits(Value* v) { return B.CreateBitCast(v, I); }
+		Value* fromBits(Value* v) { return B.CreateBitCast(v, T); }
+
+		/* Horner evaluation of c[0] + c[1] x + ... + c[n - 1] x^(n - 1). */
+		Value* poly(const double* c, unsigned n, Value* x) {
+			Value* p = fp(c[n - 1]);
+			for (int i = n - 2; i >= 0; i--) {
+				p = B.CreateFAdd(B.CreateFMul(p, x), fp(c[i]));
+			}
+			return p;
+		}
+
+		/*
+		* exp(x) = 2^k * e^r with k = round(x / ln2) and |r| <= ln2 / 2. 2^k is
+		* applied as two factors so that the largest and smallest k stay
+		* representable; both are normal, so results that underflow to subnormals
+		* are only rounded once, by the last multiplication.
+		*/
+		Value* exp(Value* x, unsigned n) {
+			Value* xc = B.CreateSelect(B.CreateFCmpOGT(x, fp(K.expClampHigh)), fp(K.expClampHigh), x);
+			xc = B.CreateSelect(B.CreateFCmpOLT(xc, fp(K.expClampLow)), fp(K.expClampLow), xc);
+			Value* kd = B.CreateFAdd(B.CreateFMul(xc, fp(K.invLn2)), fp(K.shift));
+			Value* k = B.CreateSub(bits(kd), bits(fp(K.shift)));
+			kd = B.CreateFSub(kd, fp(K.shift));
+			Value* r = B.CreateFSub(B.CreateFSub(xc, B.CreateFMul(kd, fp(K.ln2Hi))), B.CreateFMul(kd, fp(K.ln2Lo)));
+			Value* k1 = B.CreateSDiv(k, integer(2));
+			Value* s1 = fromBits(B.CreateShl(B.CreateAdd(k1, integer(K.bias)), K.mantissaBits));
+			Value* s2 = fromBits(B.CreateShl(B.CreateAdd(B.CreateSub(k, k1), integer(K.bias)), K.mantissaBits));
+			Value* res = B.CreateFMul(B.CreateFMul(poly(ExpCoefficients, n, r), s1), s2);
+			res = B.CreateSelect(B.CreateFCmpOGT(x, fp(K.expInfinityAbove)), ConstantFP::getInfinity(T), res);
+			return B.CreateSelect(B.CreateFCmpOLT(x, fp(K.expZeroBelow)), fp(0), res);
+		}
+
+		/*
+		* log(x) = k ln2 + log(m) with m in [sqrt(1/2), sqrt(2)), and
+		* log(m) = 2 atanh(s) with s = (m - 1) / (m + 1), |s| <= 0.172. The
+		* exponent field placed in the mantissa of 2^mantissaBits converts it to
+		* floating point without an int to fp conversion.
+		*/
+		Value* log(Value* x, unsigned n) {
+			Value* sub = B.CreateFCmpOLT(x, fp(K.minNormal));
+			Value* xs = B.CreateSelect(sub, B.CreateFMul(x, fp(K.subnormalScale)), x);
+			Value* b = bits(xs);
+			Value* exponent = B.CreateAnd(B.CreateLShr(b, K.mantissaBits), integer(K.exponentMask));
+			Value* k = fromBits(B.CreateOr(exponent, bits(fp(std::ldexp(1.0, K.mantissaBits)))));
+			k = B.CreateFSub(k, fp(std::ldexp(1.0, K.mantissaBits) + K.bias));
+			k = B.CreateFSub(k, B.CreateSelect(sub, fp(K.subnormalExponent), fp(0)));
+			Value* m = fromBits(B.CreateOr(B.CreateAnd(b, integer(K.mantissaMask)), integer(K.one)));
+			Value* big = B.CreateFCmpOGT(m, fp(1.41421356237309504880));
+			m = B.CreateSelect(big, B.CreateFMul(m, fp(0.5)), m);
+			k = B.CreateSelect(big, B.CreateFAdd(k, fp(1)), k);
+			Value* s = B.CreateFDiv(B.CreateFSub(m, fp(1)), B.CreateFAdd(m, fp(1)));
+			Value* tail = B.CreateFAdd(B.CreateFMul(s, poly(LogCoefficients, n, B.CreateFMul(s, s))), B.CreateFMul(k, fp(K.ln2Lo)));
+			Value* res = B.CreateFAdd(B.CreateFMul(k, fp(K.ln2Hi)), tail);
+			res = B.CreateSelect(B.CreateFCmpOLT(x, fp(0)), ConstantFP::getNaN(T), res);
+			res = B.CreateSelect(B.CreateFCmpOEQ(x, fp(0)), ConstantFP::getInfinity(T, true), res);
+			res = B.CreateSelect(B.CreateFCmpOEQ(x, ConstantFP::getInfinity(T)), ConstantFP::getInfinity(T), res);
+			return B.CreateSelect(B.CreateFCmpUNO(x, x), x, res);
+		}
+
+		/*
+		* Reduces x to r in [-pi/4, pi/4] and the quadrant q, then evaluates sin(r)
+		* and cos(r). cosine is the sine of the next quadrant.
+		*/
+		Value* sincos(Value* x, unsigned sinTerms, unsigned cosTerms, bool cosine) {
+			Value* qd = B.CreateFAdd(B.CreateFMul(x, fp(K.invPio2)), fp(K.shift));
+			Value* q = B.CreateAdd(B.CreateSub(bits(qd), bits(fp(K.shift))), integer(cosine));
+			qd = B.CreateFSub(qd, fp(K.shift));
+			Value* r = x;
+			for (unsigned i = 0; i < 3; i++) {
+				r = B.CreateFSub(r, B.CreateFMul(qd, fp(K.pio2[i])));
+			}
+			Value* z = B.CreateFMul(r, r);
+			Value* s = B.CreateFMul(r, poly(SinCoefficients, sinTerms, z));
+			Value* c = poly(CosCoefficients, cosTerms, z);
+			Value* res = B.CreateSelect(B.CreateICmpNE(B.CreateAnd(q, integer(1)), integer(0)), c, s);
+			return B.CreateSelect(B.CreateICmpNE(B.CreateAnd(q, integer(2)), integer(0)), B.CreateFNeg(res), res);
+		}
+	};
+}
+
+namespace {
+	const unsigned VectorWidths[] = {2, 4, 8, 16};
+
+	/*
+	* Returns approx_<name>[f]_large, which the kernels call for inputs outside
+	* their domain. It only calls the llvm intrinsic, but it is kept out of line
+	* and carries vector variants (approx_<name>[f]_large_v<width>) that only
+	* call the intrinsic if some lane is outside the domain. Otherwise the loop
+	* vectorizer would widen the intrinsic itself and compute libm results for
+	* every element.
+	*/
+	Function* getLargeInputs(Module &M, const LibmKernel &kernel, Type* T) {
+		bool isFloat = T->isFloatTy();
+		std::string name = std::string("approx_") + kernel.name + (isFloat ? "f" : "") + "_large";
+		if (Function* F = M.getFunction(name)) {
+			return F;
+		}
+
+		LLVMContext &C = M.getContext();
+		std::vector<GlobalValue*> variants;
+		std::string mappings;
+		for (unsigned w = 0; w < sizeof(VectorWidths) / sizeof(VectorWidths[0]); w++) {
+			unsigned width = VectorWidths[w];
+			Type* VT = FixedVectorType::get(T, width);
+			std::string variantName = name + "_v" + std::to_string(width);
+			Function* V = Function::Create(FunctionType::get(VT, VT, false), GlobalValue::InternalLinkage, variantName, M);
+			V->setDoesNotAccessMemory();
+			V->setDoesNotThrow();
+			V->setWillReturn();
+			Value* x = V->getArg(0);
+			x->setName("x");
+
+			BasicBlock* entry = BasicBlock::Create(C, "entry", V);
+			BasicBlock* large = BasicBlock::Create(C, "large", V);
+			BasicBlock* inDomain = BasicBlock::Create(C, "in.domain", V);
+			IRBuilder<> B(entry);
+			Value* outside = B.CreateFCmpOGT(B.CreateUnaryIntrinsic(Intrinsic::fabs, x), ConstantFP::get(VT, kernel.domain[isFloat]));
+			B.CreateCondBr(B.CreateOrReduce(outside), large, inDomain, MDBuilder(C).createBranchWeights(1, 1 << 20));
+			B.SetInsertPoint(large);
+			B.CreateRet(B.CreateUnaryIntrinsic(kernel.intrinsic, x));
+			// The caller only uses the lanes outside the domain.
+			B.SetInsertPoint(inDomain);
+			B.CreateRet(x);
+
+			variants.push_back(V);
+			mappings += (mappings.empty() ? "" : ",") + std::string("_ZGV_LLVM_N") + std::to_string(width) + "v_" +
+				name + "(" + variantName + ")";
+		}
+		// Nothing calls the variants until the loop vectorizer does.
+		appendToCompilerUsed(M, variants);
+
+		Function* F = Function::Create(FunctionType::get(T, T, false), GlobalValue::InternalLinkage, name, M);
+		F->setDoesNotAccessMemory();
+		F->setDoesNotThrow();
+		F->setWillReturn();
+		F->addFnAttr(Attribute::NoInline);
+		F->addFnAttr("vector-function-abi-variant", mappings);
+		F->getArg(0)->setName("x");
+		IRBuilder<> B(BasicBlock::Create(C, "entry", F));
+		B.CreateRet(B.CreateUnaryIntrinsic(kernel.intrinsic, F->getArg(0)));
+		return F;
+	}
+}
+
+namespace approxkernels {
+	Function* getKernel(Module &M, const LibmKernel &kernel, Type* T, bool fast) {
+		bool isFloat = T->isFloatTy();
+		std::string name = std::string("approx_") + kernel.name + (isFloat ? "f" : "") + (fast ? "_fast" : "_accurate");
+		if (Function* F = M.getFunction(name)) {
+			return F;
+		}
+
+		LLVMContext &C = M.getContext();
+		Function* F = Function::Create(FunctionType::get(T, T, false), GlobalValue::InternalLinkage, name, M);
+		F->setDoesNotAccessMemory();
+		F->setDoesNotThrow();
+		F->setWillReturn();
+		F->addFnAttr(Attribute::AlwaysInline);
+		Value* x = F->getArg(0);
+		x->setName("x");
+
+		BasicBlock* entry = BasicBlock::Create(C, "entry", F);
+		IRBuilder<> B(entry);
+		KernelBuilder K(B, T);
+		const Variant &variant = fast ? kernel.fast[isFloat] : kernel.accurate[isFloat];
+
+		// The reduction loses precision for large |x|; those inputs take the
+		// (unlikely) path to libm. The mappings are copied to the call because
+		// the vectorizer only looks for them on call sites.
+		if (kernel.domain[isFloat] != 0) {
+			BasicBlock* reduce = BasicBlock::Create(C, "reduce", F);
+			BasicBlock* large = BasicBlock::Create(C, "large", F);
+			Value* ax = B.CreateUnaryIntrinsic(Intrinsic::fabs, x);
+			B.CreateCondBr(B.CreateFCmpOGT(ax, K.fp(kernel.domain[isFloat])), large, reduce,
+				MDBuilder(C).createBranchWeights(1, 1 << 20));
+			B.SetInsertPoint(large);
+			Function* largeInputs = getLargeInputs(M, kernel, T);
+			CallInst* call = B.CreateCall(largeInputs, x);
+			call->addFnAttr(largeInputs->getFnAttribute("vector-function-abi-variant"));
+			B.CreateRet(call);
+			B.SetInsertPoint(reduce);
+		}
+
+		Value* res;
+		if (kernel.intrinsic == Intrinsic::exp) {
+			res = K.exp(x, variant.terms[0]);
+		} else if (kernel.intrinsic == Intrinsic::log) {
+			res = K.log(x, variant.terms[0]);
+		} else {
+			res = K.sincos(x, variant.terms[0], variant.terms[1], kernel.intrinsic == Intrinsic::cos);
+		}
+		B.CreateRet(res);
+		return F;
+	}
+
+	std::string describeError(const LibmKernel &kernel, bool isFloat, bool fast) {
+		std::string text;
+		raw_string_ostream OS(text);
+		double error = fast ? kernel.fast[isFloat].maxError : kernel.accurate[isFloat].maxError;
+		switch (kernel.errorKind) {
+		case Exact:
+			return "exact result";
+		case Relative:
+			OS << "relative error ";
+			break;
+		case Absolute:
+			OS << "absolute error ";
+			break;
+		case AbsoluteBelowOne:
+			OS << "absolute error (relative where the result exceeds 1) ";
+			break;
+		}
+		OS << format("%.1e", error);
+		if (kernel.domain[isFloat] != 0) {
+			OS << " for |x| <= " << format("%.0e", kernel.domain[isFloat]) << " (libm beyond)";
+		}
+		return OS.str();
+	}
+}
@@ -0,0 +1,69 @@
+#ifndef APPROXCHECK_APPROXKERNELS_H
+#define APPROXCHECK_APPROXKERNELS_H
+
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include <string>
+
+/*
+* Approximate libm kernels that ApproxCheck -approx-libm=<mode> substitutes for
+* exp, log, sin and cos calls whose results never reach an address or a
+* branch. They are built directly as IR in the module being compiled and
+* inlined at the call site, so no runtime library is needed and the calling
+* loops can be vectorized. Each kernel is a range reduction plus a fixed degree
+* polynomial; special cases are selects, not branches. The _accurate and
+* _fast variants only differ in polynomial degree.
+*
+* sqrt is replaced by the llvm.sqrt intrinsic, which is exact and already
+* vectorizable.
+*/
+namespace approxkernels {
+	enum ErrorKind {
+		Exact,
+		Relative,        // |kernel(x) - f(x)| / max(|f(x)|, smallest normal)
+		Absolute,        // |kernel(x) - f(x)|
+		AbsoluteBelowOne // absolute where |f(x)| <= 1, relative above
+	};
+
+	struct Variant {
+		unsigned terms[2]; // polynomial terms (sin and cos terms for sin/cos)
+		double maxError;   // measured with bench/libm_error.py
+	};
+
+	/*
+	* A libm function -approx-libm can replace. Everything that is specific to
+	* one function lives here; the arrays are indexed {double, float}. Inputs
+	* with |x| > domain are passed on to the llvm intrinsic instead, so maxError
+	* holds for every input (domain 0 means the kernel covers all inputs).
+	*/
+	struct LibmKernel {
+		llvm::LibFunc doubleFunc;
+		llvm::LibFunc floatFunc;
+		llvm::Intrinsic::ID intrinsic;
+		const char* name;
+		ErrorKind errorKind;
+		double domain[2];
+		Variant accurate[2];
+		Variant fast[2];
+	};
+
+	extern const LibmKernel LibmKernels[];
+	extern const unsigned NumLibmKernels;
+
+	/*
+	* Returns the definition of kernel's _accurate or _fast variant for T (double
+	* or float), building it into M the first time. The function is internal
+	* and only exists to be inlined.
+	*/
+	llvm::Function* getKernel(llvm::Module &M, const LibmKernel &kernel, llvm::Type* T, bool fast);
+
+	/*
+	* Describes the error of a variant, e.g. "absolute error 2.1e-16 for |x| <= 1e+05
+	* (libm beyond)".
+	*/
+	std::string describeError(const LibmKernel &kernel, bool isFloat, bool fast);
+}
+
+#endif
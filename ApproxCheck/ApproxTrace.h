@@ -0,0 +1,44 @@
+#ifndef APPROXCHECK_APPROXTRACE_H
+#define APPROXCHECK_APPROXTRACE_H
+
+#include <cstdint>
+
+/*
+* Binary format of the analysis-decision trace written with -approx-trace=<file>
+* and read back by approx-trace-decode.
+*
+* The file starts with TraceMagic, followed by fixed size Records. Events name
+* values by their address in the compiler, so writing one needs no lookup. A
+* FunctionBegin record is directly followed by the function name (record.from
+* bytes, not terminated) and then the addresses of its record.to instructions
+* (uint64_t each, in inst_begin order), each zero padded to a multiple of the
+* record size. The decoder numbers instructions by their position in that
+* table; other values (arguments, globals) are not in it.
+*/
+namespace approxtrace {
+	static const char TraceMagic[8] = {'A', 'P', 'X', 'T', 'R', 'C', '0', '2'};
+
+	enum EventKind : uint8_t {
+		FunctionBegin,  // from = length of the name, to = number of instructions
+		ChainStart,     // step 1: use-def walk starts at "to"
+		MarkApplied,    // "to" marked as non-approximate-able while visiting "from"
+		RootDiscovered, // load "from" reads through address "to", added to addrList
+		SameAddress,    // step 3: "to" computes the same address as root "from"
+		EdgeFollowed,   // def-use edge "from" -> "to" followed from a root
+		StoreMatched,   // store "to" writes into an addrList address
+		NumEventKinds
+	};
+
+	struct Record {
+		uint8_t kind;
+		uint8_t opcode;   // LLVM opcode of "to", 0 if it is not an instruction
+		int16_t level;    // recursion depth, 0 where it has no meaning
+		uint32_t padding; // always 0
+		uint64_t from;    // address of a value, 0 for none
+		uint64_t to;
+	};
+
+	static_assert(sizeof(Record) == 24, "trace records must stay 24 bytes");
+}
+
+#endif
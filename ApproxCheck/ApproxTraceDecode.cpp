@@ -0,0 +1,132 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "ApproxTrace.h"
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace llvm;
+
+static cl::opt<std::string> InputFile(cl::Positional, cl::desc("<trace file>"), cl::Required);
+
+static cl::opt<bool> Counts("counts",
+	cl::desc("Only print the number of events of each kind per function"),
+	cl::init(false));
+
+static const char* EventNames[approxtrace::NumEventKinds] = {
+	"function", "chain-start", "mark", "root", "same-address", "edge", "store-matched"
+};
+
+/*
+* Prints a value reference as #<position> (<opcode>) if it is one of the
+* instructions of the current function.
+*/
+static void printValue(const DenseMap<uint64_t, uint32_t> &positions, uint64_t address, uint8_t opcode) {
+	DenseMap<uint64_t, uint32_t>::const_iterator found = positions.find(address);
+	if (found == positions.end()) {
+		outs() << "<value>";
+		return;
+	}
+	outs() << "#" << found->second;
+	if (opcode) {
+		outs() << " (" << Instruction::getOpcodeName(opcode) << ")";
+	}
+}
+
+/*
+* Size of a FunctionBegin payload of the given bytes, padded to whole records.
+*/
+static uint64_t padded(uint64_t bytes) {
+	return (bytes + sizeof(approxtrace::Record) - 1) / sizeof(approxtrace::Record) * sizeof(approxtrace::Record);
+}
+
+static void printCounts(StringRef name, std::vector<uint64_t> &counts) {
+	outs() << name << ":";
+	for (unsigned k = 1; k < approxtrace::NumEventKinds; k++) {
+		outs() << " " << EventNames[k] << "=" << counts[k];
+		counts[k] = 0;
+	}
+	outs() << "\n";
+}
+
+/*
+* Decodes a trace written by ApproxCheck -approx-trace=<file> into text.
+*/
+int main(int argc, char** argv) {
+	cl::ParseCommandLineOptions(argc, argv, "ApproxCheck trace decoder\n");
+
+	ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(InputFile);
+	if (!buffer) {
+		errs() << "approx-trace-decode: cannot read " << InputFile << ": " << buffer.getError().message() << "\n";
+		return 1;
+	}
+	const char* p = (*buffer)->getBufferStart();
+	const char* end = (*buffer)->getBufferEnd();
+	if (end - p < (long)sizeof(approxtrace::TraceMagic) || memcmp(p, approxtrace::TraceMagic, sizeof(approxtrace::TraceMagic)) != 0) {
+		errs() << "approx-trace-decode: " << InputFile << " is not an ApproxCheck trace\n";
+		return 1;
+	}
+	p += sizeof(approxtrace::TraceMagic);
+
+	std::string function;
+	DenseMap<uint64_t, uint32_t> positions; // instruction address -> position in the function
+	std::vector<uint64_t> counts(approxtrace::NumEventKinds, 0);
+	while (end - p >= (long)sizeof(approxtrace::Record)) {
+		approxtrace::Record r;
+		memcpy(&r, p, sizeof(r));
+		p += sizeof(r);
+
+		if (r.kind >= approxtrace::NumEventKinds) {
+			errs() << "approx-trace-decode: bad record kind " << (unsigned)r.kind << "\n";
+			return 1;
+		}
+
+		if (r.kind == approxtrace::FunctionBegin) {
+			// The name and the instruction addresses are padded to whole records.
+			uint64_t nameSize = padded(r.from);
+			uint64_t tableSize = padded(r.to * sizeof(uint64_t));
+			if ((uint64_t)(end - p) < nameSize + tableSize) {
+				break;
+			}
+			if (Counts && !function.empty()) {
+				printCounts(function, counts);
+			}
+			function.assign(p, r.from);
+			p += nameSize;
+			positions.clear();
+			for (uint32_t i = 0; i < r.to; i++) {
+				uint64_t address;
+				memcpy(&address, p + i * sizeof(address), sizeof(address));
+				positions[address] = i;
+			}
+			p += tableSize;
+			if (!Counts) {
+				outs() << "\n=== " << function << " ===\n";
+			}
+			continue;
+		}
+
+		if (Counts) {
+			counts[r.kind]++;
+			continue;
+		}
+		outs() << EventNames[r.kind] << " (" << r.level << ") ";
+		if (r.from) {
+			printValue(positions, r.from, 0);
+			outs() << " -> ";
+		}
+		printValue(positions, r.to, r.opcode);
+		outs() << "\n";
+	}
+	if (Counts && !function.empty()) {
+		printCounts(function, counts);
+	}
+
+	if (p != end) {
+		errs() << "approx-trace-decode: trace is truncated\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+* Measures the maximum error of the -approx-libm kernels against long double
+* libm. Linked with the wrappers bench/libm_error.py generates, which store
+* libm results the pass replaced with (inlined) kernels.
+*/
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WRAPPERS(name) \
+	void name##_accurate(double x, double* out); \
+	void name##_fast(double x, double* out); \
+	void name##f_accurate(float x, float* out); \
+	void name##f_fast(float x, float* out);
+WRAPPERS(exp)
+WRAPPERS(log)
+WRAPPERS(sin)
+WRAPPERS(cos)
+
+typedef void (*DoubleKernel)(double, double*);
+typedef void (*FloatKernel)(float, float*);
+enum ErrorKind { Relative, Absolute, AbsoluteBelowOne };
+
+static double uniform(double lo, double hi) {
+	return lo + (hi - lo) * (rand() / (double)RAND_MAX);
+}
+
+/* Uniform in the exponent, with a random sign if negative is set. */
+static double logUniform(double lo, double hi, int negative) {
+	double x = exp(uniform(log(lo), log(hi)));
+	return negative && rand() % 2 ? -x : x;
+}
+
+/*
+* Relative errors are taken relative to at least minNormal, the smallest normal
+* number of the kernel's type: a subnormal result only has the absolute
+* precision of the smallest normal.
+*/
+static double error(long double result, long double expected, enum ErrorKind kind, long double minNormal) {
+	long double e = fabsl(result - expected);
+	if (kind == Relative) {
+		e = e / fmaxl(fabsl(expected), minNormal);
+	} else if (kind == AbsoluteBelowOne && fabsl(expected) > 1) {
+		e = e / fabsl(expected);
+	}
+	return e;
+}
+
+/*
+* Samples [lo, hi] (uniformly, or uniformly in the exponent with logScale; -1
+* also picks a random sign) and prints the largest error of the double and the
+* float kernel. Either kernel may be NULL.
+*/
+static void measure(const char* name, DoubleKernel d, FloatKernel f, long double (*ref)(long double),
+		double lo, double hi, int logScale, enum ErrorKind kind) {
+	double maxDouble = 0, maxFloat = 0;
+	for (int i = 0; i < 1000000; i++) {
+		double x = logScale ? logUniform(lo, hi, logScale < 0) : uniform(lo, hi);
+		if (d) {
+			double r;
+			d(x, &r);
+			double e = error(r, ref(x), kind, DBL_MIN);
+			maxDouble = e > maxDouble ? e : maxDouble;
+		}
+		if (f) {
+			float r;
+			f((float)x, &r);
+			double e = error(r, ref((float)x), kind, FLT_MIN);
+			maxFloat = e > maxFloat ? e : maxFloat;
+		}
+	}
+	printf("%-14s [%8.2g, %8.2g]", name, lo, hi);
+	printf(d ? "  double %.2e" : "  double    -    ", maxDouble);
+	printf(f ? "  float %.2e\n" : "  float    -\n", maxFloat);
+}
+
+int main(void) {
+	/* Below -87.3 (float) and -708.4 (double) the results are subnormal. */
+	measure("exp_accurate", exp_accurate, expf_accurate, expl, -104, 88, 0, Relative);
+	measure("exp_accurate", exp_accurate, NULL, expl, -746, 709, 0, Relative);
+	measure("exp_accurate", exp_accurate, expf_accurate, expl, -104, -87, 0, Relative);
+	measure("exp_accurate", exp_accurate, NULL, expl, -746, -708, 0, Relative);
+	measure("exp_fast", exp_fast, expf_fast, expl, -104, 88, 0, Relative);
+	measure("exp_fast", exp_fast, NULL, expl, -746, 709, 0, Relative);
+	measure("exp_fast", exp_fast, expf_fast, expl, -104, -87, 0, Relative);
+	measure("exp_fast", exp_fast, NULL, expl, -746, -708, 0, Relative);
+	measure("log_accurate", log_accurate, logf_accurate, logl, 0.5, 2, 0, AbsoluteBelowOne);
+	measure("log_accurate", log_accurate, logf_accurate, logl, 1e-37, 1e38, 1, AbsoluteBelowOne);
+	measure("log_accurate", log_accurate, NULL, logl, 1e-307, 1e308, 1, AbsoluteBelowOne);
+	measure("log_fast", log_fast, logf_fast, logl, 0.5, 2, 0, AbsoluteBelowOne);
+	measure("log_fast", log_fast, logf_fast, logl, 1e-37, 1e38, 1, AbsoluteBelowOne);
+	measure("log_fast", log_fast, NULL, logl, 1e-307, 1e308, 1, AbsoluteBelowOne);
+
+	/* The domains of the sin and cos kernels are 1e5 (double) and 1e4 (float). */
+	measure("sin_accurate", sin_accurate, sinf_accurate, sinl, 1e-3, 1e4, -1, Absolute);
+	measure("sin_accurate", sin_accurate, NULL, sinl, 1e4, 1e5, -1, Absolute);
+	measure("sin_fast", sin_fast, sinf_fast, sinl, 1e-3, 1e4, -1, Absolute);
+	measure("sin_fast", sin_fast, NULL, sinl, 1e4, 1e5, -1, Absolute);
+	measure("cos_accurate", cos_accurate, cosf_accurate, cosl, 1e-3, 1e4, -1, Absolute);
+	measure("cos_accurate", cos_accurate, NULL, cosl, 1e4, 1e5, -1, Absolute);
+	measure("cos_fast", cos_fast, cosf_fast, cosl, 1e-3, 1e4, -1, Absolute);
+	measure("cos_fast", cos_fast, NULL, cosl, 1e4, 1e5, -1, Absolute);
+	/* Beyond the domain the kernels call libm. */
+	measure("sin_fast", sin_fast, sinf_fast, sinl, 1e5, 1e30, -1, Absolute);
+	measure("cos_fast", cos_fast, NULL, cosl, 1e30, 1e300, -1, Absolute);
+	return 0;
+}
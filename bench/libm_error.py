@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+#
+# Measures the maximum error of the -approx-libm kernels, which is what the
+# table in ApproxCheck/ApproxKernels.cpp reports. Wrappers that store exp, log,
+# sin and cos results are run through the pass, compiled with llc and linked
+# with bench/libm_error.c.
+#
+#   $ python3 bench/libm_error.py build/ApproxCheck/libApproxCheck.so
+#
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def generate(mode):
+	lines = []
+	for name in ["exp", "log", "sin", "cos"]:
+		for suffix, t in [("", "double"), ("f", "float")]:
+			lines.append("declare %s @%s%s(%s)" % (t, name, suffix, t))
+			lines.append("define void @%s%s_%s(%s %%x, %s* %%out) {" % (name, suffix, mode, t, t))
+			lines.append("  %%r = call %s @%s%s(%s %%x)" % (t, name, suffix, t))
+			lines.append("  store %s %%r, %s* %%out" % (t, t))
+			lines.append("  ret void")
+			lines.append("}")
+	return "\n".join(lines) + "\n"
+
+
+def main():
+	if len(sys.argv) != 2:
+		sys.exit("usage: libm_error.py <libApproxCheck.so>")
+	plugin = sys.argv[1]
+	harness = os.path.join(os.path.dirname(os.path.abspath(__file__)), "libm_error.c")
+	with tempfile.TemporaryDirectory() as tmp:
+		objects = []
+		for mode in ["accurate", "fast"]:
+			source = os.path.join(tmp, mode + ".ll")
+			with open(source, "w") as f:
+				f.write(generate(mode))
+			approx = os.path.join(tmp, mode + ".bc")
+			subprocess.run(["opt", "-enable-new-pm=0", "-load", plugin, "-ApproxCheck", "-approx-libm=" + mode,
+				source, "-o", approx], stderr=subprocess.DEVNULL, check=True)
+			objects.append(os.path.join(tmp, mode + ".o"))
+			subprocess.run(["llc", "-O2", "-filetype=obj", "-relocation-model=pic", approx, "-o", objects[-1]], check=True)
+		exe = os.path.join(tmp, "libm_error")
+		subprocess.run(["cc", "-O2", harness] + objects + ["-o", exe, "-lm"], check=True)
+		subprocess.run([exe], check=True)
+
+
+if __name__ == "__main__":
+	main()
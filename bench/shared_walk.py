@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+#
+# Compares the default and the -approx-shared-walk root propagation on a
+# generated function with N address roots that all feed one accumulator chain,
+# so every root reaches O(N) values.
+#
+#   $ python3 bench/shared_walk.py build/ApproxCheck/libApproxCheck.so 500 1000 2000
+#
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def generate(n):
+	lines = ["@out = global i32 0", "", "define void @roots(i32* %p) {", "entry:"]
+	acc = "0"
+	for i in range(n):
+		lines.append("  %%slot%d = alloca i32*" % i)
+		lines.append("  store i32* %%p, i32** %%slot%d" % i)
+		lines.append("  %%ptr%d = load i32*, i32** %%slot%d" % (i, i))
+		lines.append("  %%val%d = load i32, i32* %%ptr%d" % (i, i))
+		lines.append("  %%acc%d = add i32 %s, %%val%d" % (i, acc, i))
+		acc = "%%acc%d" % i
+	lines.append("  store i32 %s, i32* @out" % acc)
+	lines.append("  ret void")
+	lines.append("}")
+	return "\n".join(lines) + "\n"
+
+
+def run(plugin, path, extra):
+	best = None
+	for _ in range(3):
+		start = time.perf_counter()
+		subprocess.run(["opt", "-enable-new-pm=0", "-load", plugin, "-ApproxCheck"] + extra + ["-disable-output", path],
+			stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=True)
+		elapsed = time.perf_counter() - start
+		best = elapsed if best is None else min(best, elapsed)
+	return best * 1000
+
+
+def main():
+	if len(sys.argv) < 2:
+		sys.exit("usage: shared_walk.py <libApproxCheck.so> [N...]")
+	plugin = sys.argv[1]
+	sizes = [int(n) for n in sys.argv[2:]] or [500, 1000, 2000]
+	print("%8s %12s %12s" % ("roots", "default ms", "shared ms"))
+	with tempfile.TemporaryDirectory() as tmp:
+		for n in sizes:
+			path = os.path.join(tmp, "roots%d.ll" % n)
+			with open(path, "w") as f:
+				f.write(generate(n))
+			print("%8d %12.0f %12.0f" % (n, run(plugin, path, []), run(plugin, path, ["-approx-shared-walk"])))
+
+
+if __name__ == "__main__":
+	main()
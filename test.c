@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <math.h>
 
 typedef struct {
   int x;
@@ -199,6 +200,49 @@ void extra8(int* addr, int x) {
   ints[addr[x+x]] = 12345;
 }
 
+/* With -approx-summaries the first add in summaryCaller can be approximated:
+   summaryCallee only returns data, and the caller only stores the result. The
+   caller comes first, so this needs the callee to be summarised before it. */
+int summaryCallee(int data, int index);
+
+void summaryCaller(int arg1, Point p) {
+  ints[0] = summaryCallee(p.x + p.y, arg1 + 1);
+}
+
+int summaryCallee(int data, int index) {
+  ints[index] = 1;
+  return data * 2;
+}
+
+/* Here the add stays exact: outCallee stores data through out, and the caller
+   then uses what it stored as an index. */
+void outCallee(int data, int* out) {
+  *out = data;
+}
+
+void outCaller(int x) {
+  int t;
+  outCallee(x + 1, &t);
+  ints[t] = 0;
+}
+
+double samples[10];
+
+/* With -approx-libm the exp, sin, sqrt and cosf calls can be replaced: their
+   results are only stored. The log result becomes an index and stays exact. */
+void libmApprox(double x, float y) {
+  samples[0] = exp(x) + sin(x);
+  samples[1] = sqrt(x) * cosf(y);
+  ints[(int)log(x)] = 1;
+}
+
+/* Once the kernels are inlined this loop can be vectorized. */
+void libmLoop(double* out, double* in, int n) {
+  for (int i = 0; i < n; i++) {
+    out[i] = exp(in[i]) * cos(in[i]);
+  }
+}
+
 int main(int argc, char *argv[]) {
 
 }